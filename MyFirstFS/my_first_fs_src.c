@@ -3,6 +3,101 @@
 #include <linux/fs.h>
 #include <linux/timekeeping.h>
 #include <linux/time.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
+#include <linux/statfs.h>
+#include <linux/percpu_counter.h>
+#include <linux/uio.h>
+#include <linux/swap.h>
+
+#define FIRSTFS_MAGIC 0x42424242
+
+//all the data lives in the page cache, there is no device behind it (like ramfs)
+//the only thing we keep is how many pages we are using, so a mount cannot eat all the memory
+struct firstfs_fs_info {
+    unsigned long max_pages; //0 means no limit
+    struct percpu_counter used_pages;
+};
+
+static const struct super_operations firstfs_super_ops;
+static const struct inode_operations firstfs_dir_inode_ops;
+static const struct inode_operations firstfs_file_inode_ops;
+static const struct file_operations firstfs_file_ops;
+static const struct address_space_operations firstfs_aops;
+
+// take a page from the mount budget for the inode, false if the mount is full
+// a percpu counter so that parallel writers do not fight over a single cache line
+// the inode keeps what it has been charged in i_blocks (so du works too)
+static bool firstfs_charge_page(struct inode *inode)
+{
+    struct firstfs_fs_info *fs_info = inode->i_sb->s_fs_info;
+
+    if (fs_info->max_pages && percpu_counter_compare(&fs_info->used_pages, fs_info->max_pages) >= 0)
+        return false;
+
+    percpu_counter_inc(&fs_info->used_pages);
+
+    spin_lock(&inode->i_lock);
+    inode->i_blocks += PAGE_SIZE >> 9;
+    spin_unlock(&inode->i_lock);
+    return true;
+}
+
+//give back to the mount the pages that left the page cache (truncate or evict)
+//every page in the cache has been charged, so the difference with nrpages is what was freed
+static void firstfs_recalc_inode(struct inode *inode)
+{
+    struct firstfs_fs_info *fs_info = inode->i_sb->s_fs_info;
+    long freed;
+
+    spin_lock(&inode->i_lock);
+    freed = (inode->i_blocks >> (PAGE_SHIFT - 9)) - inode->i_mapping->nrpages;
+    if (freed > 0)
+        inode->i_blocks -= (blkcnt_t)freed << (PAGE_SHIFT - 9);
+    spin_unlock(&inode->i_lock);
+
+    if (freed > 0)
+        percpu_counter_sub(&fs_info->used_pages, freed);
+}
+
+//a page that is not in the page cache is a hole, we only have to zero it (and charge it)
+//read(2) never gets here (see firstfs_file_read_iter), only mmap faults on holes and they get SIGBUS
+//when the mount is full, like on tmpfs
+//if the mount is full the page is removed again, so nothing uncharged stays in the cache
+static int firstfs_readpage(struct file *file, struct page *page)
+{
+    if (!firstfs_charge_page(page->mapping->host)) {
+        delete_from_page_cache(page);
+        unlock_page(page);
+        return -ENOSPC;
+    }
+
+    return simple_readpage(file, page);
+}
+
+//the page is found or added by simple_write_begin, a page that is not uptodate has just been added and must be charged
+//our pages become uptodate in readpage or write_end and never go back
+static int firstfs_write_begin(struct file *file, struct address_space *mapping, loff_t pos, unsigned len, unsigned flags, struct page **pagep, void **fsdata)
+{
+    int ret;
+
+    ret = simple_write_begin(file, mapping, pos, len, flags, pagep, fsdata);
+    if (ret)
+        return ret;
+
+    if (!PageUptodate(*pagep) && !firstfs_charge_page(mapping->host)) {
+        delete_from_page_cache(*pagep);
+        unlock_page(*pagep);
+        put_page(*pagep);
+        return -ENOSPC;
+    }
+
+    return 0;
+}
 
 // this is the fuction to creates a new inode
 // @sb: superblock of the filesystem
@@ -20,41 +115,317 @@ struct inode *firstfs_get_inode(struct super_block *sb, const struct inode *dir,
 
         //inits inode users
         inode_init_owner(inode, dir, mode);
-        
+
         ktime_get_real_ts64(&curr_time);
         inode->i_atime = inode->i_mtime = inode->i_ctime = curr_time;
 
+        //pages of this inode can never be written anywhere, keep them out of reclaim
+        inode->i_mapping->a_ops = &firstfs_aops;
+        mapping_set_gfp_mask(inode->i_mapping, GFP_HIGHUSER);
+        mapping_set_unevictable(inode->i_mapping);
+
         switch (mode & S_IFMT) {
         //new inode is a dir
         case S_IFDIR:
+            inode->i_op = &firstfs_dir_inode_ops;
+            inode->i_fop = &simple_dir_operations;
             /* i_nlink will be initialized to 1 in the inode_init_always function
              * (that gets called inside the new_inode function),
              * We change it to 2 for directories, for covering the "." entry */
             //number of links that exists for this inode (its new so only one)
             inc_nlink(inode);
             break;
-        //new
+        //new file, read/write/mmap all go through the page cache
         case S_IFREG:
+            inode->i_op = &firstfs_file_inode_ops;
+            inode->i_fop = &firstfs_file_ops;
+            break;
+        //the target of the link is stored in the first page
         case S_IFLNK:
+            inode->i_op = &page_symlink_inode_operations;
+            inode_nohighmem(inode);
+            break;
+        //fifo, socket or device
         default:
-            printk(KERN_ERR "firstfs can create meaningful inode for only root directory at the moment\n");
-            return NULL;
+            init_special_inode(inode, mode, dev);
             break;
         }
     }
     return inode;
 }
 
+//all the directory operations end up here
+//the dentry gets an extra reference, it is what keeps our files alive since there is nothing on a device
+static int firstfs_mknod(struct inode *dir, struct dentry *dentry, umode_t mode, dev_t dev)
+{
+    struct inode *inode = firstfs_get_inode(dir->i_sb, dir, mode, dev);
+
+    if (!inode)
+        return -ENOSPC;
+
+    d_instantiate(dentry, inode);
+    dget(dentry);
+    dir->i_mtime = dir->i_ctime = current_time(dir);
+    return 0;
+}
+
+static int firstfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+    int ret = firstfs_mknod(dir, dentry, mode | S_IFDIR, 0);
+
+    //the ".." of the new directory
+    if (!ret)
+        inc_nlink(dir);
+    return ret;
+}
+
+static int firstfs_create(struct inode *dir, struct dentry *dentry, umode_t mode, bool excl)
+{
+    return firstfs_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+static int firstfs_symlink(struct inode *dir, struct dentry *dentry, const char *symname)
+{
+    struct inode *inode;
+    int ret;
+
+    inode = firstfs_get_inode(dir->i_sb, dir, S_IFLNK | S_IRWXUGO, 0);
+    if (!inode)
+        return -ENOSPC;
+
+    ret = page_symlink(inode, symname, strlen(symname) + 1);
+    if (ret) {
+        iput(inode);
+        return ret;
+    }
+
+    d_instantiate(dentry, inode);
+    dget(dentry);
+    dir->i_mtime = dir->i_ctime = current_time(dir);
+    return 0;
+}
+
+//lookup, link, unlink and rename only work on the dentry cache, libfs does that for us
+static const struct inode_operations firstfs_dir_inode_ops = {
+    .create = firstfs_create,
+    .lookup = simple_lookup,
+    .link = simple_link,
+    .unlink = simple_unlink,
+    .symlink = firstfs_symlink,
+    .mkdir = firstfs_mkdir,
+    .rmdir = simple_rmdir,
+    .mknod = firstfs_mknod,
+    .rename = simple_rename,
+};
+
+//a truncate can free pages
+static int firstfs_setattr(struct dentry *dentry, struct iattr *attr)
+{
+    int ret = simple_setattr(dentry, attr);
+
+    if (!ret && (attr->ia_valid & ATTR_SIZE))
+        firstfs_recalc_inode(d_inode(dentry));
+    return ret;
+}
+
+static const struct inode_operations firstfs_file_inode_ops = {
+    .setattr = firstfs_setattr,
+    .getattr = simple_getattr,
+};
+
+//read without adding anything to the page cache: holes are copied as zeros (tmpfs does the same with ZERO_PAGE)
+//so reads never use the mount budget and never fail because the mount is full
+static ssize_t firstfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *file = iocb->ki_filp;
+    struct inode *inode = file_inode(file);
+    struct address_space *mapping = inode->i_mapping;
+    ssize_t copied = 0;
+
+    while (iov_iter_count(to)) {
+        loff_t isize = i_size_read(inode);
+        pgoff_t index = iocb->ki_pos >> PAGE_SHIFT;
+        unsigned long offset = iocb->ki_pos & ~PAGE_MASK;
+        unsigned long nr;
+        struct page *page;
+        size_t ret;
+
+        if (iocb->ki_pos >= isize)
+            break;
+        nr = min_t(loff_t, PAGE_SIZE - offset, isize - iocb->ki_pos);
+
+        page = find_get_page(mapping, index);
+        if (page && !PageUptodate(page)) {
+            //a writer is filling it, once unlocked it is uptodate or it has been removed (mount full)
+            lock_page(page);
+            if (!page->mapping || !PageUptodate(page)) {
+                unlock_page(page);
+                put_page(page);
+                page = NULL;
+            } else {
+                unlock_page(page);
+            }
+        }
+
+        if (page) {
+            if (mapping_writably_mapped(mapping))
+                flush_dcache_page(page);
+            mark_page_accessed(page);
+            ret = copy_page_to_iter(page, offset, nr, to);
+            put_page(page);
+        } else {
+            ret = iov_iter_zero(nr, to);
+        }
+
+        copied += ret;
+        iocb->ki_pos += ret;
+        if (ret < nr) {
+            if (!copied)
+                copied = -EFAULT;
+            break;
+        }
+        cond_resched();
+    }
+
+    file_accessed(file);
+    return copied;
+}
+
+//the generic page cache functions do the rest of the work, there is never anything to write back
+static const struct file_operations firstfs_file_ops = {
+    .read_iter = firstfs_file_read_iter,
+    .write_iter = generic_file_write_iter,
+    .mmap = generic_file_mmap,
+    .fsync = noop_fsync,
+    .splice_read = generic_file_splice_read,
+    .splice_write = iter_file_splice_write,
+    .llseek = generic_file_llseek,
+};
+
+static const struct address_space_operations firstfs_aops = {
+    .readpage = firstfs_readpage,
+    .write_begin = firstfs_write_begin,
+    .write_end = simple_write_end,
+    .set_page_dirty = __set_page_dirty_no_writeback,
+};
+
+static int firstfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+    struct firstfs_fs_info *fs_info = dentry->d_sb->s_fs_info;
+
+    buf->f_type = dentry->d_sb->s_magic;
+    buf->f_bsize = PAGE_SIZE;
+    buf->f_namelen = NAME_MAX;
+    if (fs_info->max_pages) {
+        buf->f_blocks = fs_info->max_pages;
+        buf->f_bavail = buf->f_bfree = fs_info->max_pages - min(fs_info->max_pages, (unsigned long)percpu_counter_sum_positive(&fs_info->used_pages));
+    }
+
+    return 0;
+}
+
+//what we show in /proc/mounts
+static int firstfs_show_options(struct seq_file *seq, struct dentry *root)
+{
+    struct firstfs_fs_info *fs_info = root->d_sb->s_fs_info;
+
+    seq_printf(seq, ",size=%luk", fs_info->max_pages << (PAGE_SHIFT - 10));
+    return 0;
+}
+
+//last link and last user gone, the pages go back to the mount
+static void firstfs_evict_inode(struct inode *inode)
+{
+    truncate_inode_pages_final(&inode->i_data);
+    firstfs_recalc_inode(inode);
+    clear_inode(inode);
+}
+
+static const struct super_operations firstfs_super_ops = {
+    .statfs = firstfs_statfs,
+    .evict_inode = firstfs_evict_inode,
+    .drop_inode = generic_delete_inode,
+    .show_options = firstfs_show_options,
+};
+
+enum {
+    Opt_size, Opt_err
+};
+
+static const match_table_t tokens = {
+    {Opt_size, "size=%s"},
+    {Opt_err, NULL}
+};
+
+//parse the options passed with -o when mounting, the string is like "opt1,opt2"
+//size accepts the k, m and g suffixes, 0 is no limit
+static int firstfs_parse_options(char *options, struct firstfs_fs_info *fs_info)
+{
+    substring_t args[MAX_OPT_ARGS];
+    unsigned long long size;
+    char *p, *rest;
+    int token;
+
+    if (!options)
+        return 0;
+
+    while ((p = strsep(&options, ",")) != NULL) {
+        if (!*p)
+            continue;
+
+        token = match_token(p, tokens, args);
+        switch (token) {
+        case Opt_size:
+            size = memparse(args[0].from, &rest);
+            if (*rest) {
+                printk(KERN_ERR "firstfs: bad value for size \"%s\"\n", args[0].from);
+                return -EINVAL;
+            }
+            fs_info->max_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+            break;
+        default:
+            printk(KERN_ERR "firstfs: unrecognized mount option \"%s\"\n", p);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
 //function that fill the super block with information
-//not much inside for now
 int firstfs_fill_super(struct super_block *sb, void *data, int silent)
 {
     struct inode *inode;
+    struct firstfs_fs_info *fs_info;
+    int ret;
+
+    fs_info = kzalloc(sizeof(struct firstfs_fs_info), GFP_KERNEL);
+    if (!fs_info)
+        return -ENOMEM;
+
+    //freed in firstfs_kill_superblock, even if we fail here
+    sb->s_fs_info = fs_info;
+
+    ret = percpu_counter_init(&fs_info->used_pages, 0, GFP_KERNEL);
+    if (ret)
+        return ret;
+
+    //same default as tmpfs, half of the memory
+    fs_info->max_pages = totalram_pages() / 2;
+
+    ret = firstfs_parse_options(data, fs_info);
+    if (ret)
+        return ret;
 
     //Unique identifier of the filesystem
-    sb->s_magic = 0x42424242;
+    sb->s_magic = FIRSTFS_MAGIC;
+    sb->s_op = &firstfs_super_ops;
+    sb->s_maxbytes = MAX_LFS_FILESIZE;
+    sb->s_blocksize = PAGE_SIZE;
+    sb->s_blocksize_bits = PAGE_SHIFT;
+    sb->s_time_gran = 1;
 
-    inode = firstfs_get_inode(sb, NULL, S_IFDIR, 0);
+    inode = firstfs_get_inode(sb, NULL, S_IFDIR | 0755, 0);
     sb->s_root = d_make_root(inode);
     if (!sb->s_root)
         return -ENOMEM;
@@ -64,8 +435,17 @@ int firstfs_fill_super(struct super_block *sb, void *data, int silent)
 
 static void firstfs_kill_superblock(struct super_block *s)
 {
+    struct firstfs_fs_info *fs_info = s->s_fs_info;
+
+    //drops the extra references we keep on the dentries, so all the files go away
+    kill_litter_super(s);
+
+    if (fs_info) {
+        percpu_counter_destroy(&fs_info->used_pages);
+        kfree(fs_info);
+    }
+
     printk(KERN_INFO "firstfs superblock is destroyed. Unmount succesful.\n");
-    //we have no information in our superblock currently
     return;
 }
 
@@ -73,12 +453,10 @@ static void firstfs_kill_superblock(struct super_block *s)
 struct dentry *firstfs_mount(struct file_system_type *fs_type, int flags, const char *dev_name, void *data)
 {
     //mount_nodev is for a virtual file system, or one that doesnt need a real device
-    //return mount_nodev(fs_type, flags, data, ramfs_fill_super);
-
-    //mount_bdev is for a file system with an actual block device
+    //everything is in memory so this is our case now
     struct dentry *ret;
 
-    ret = mount_bdev(fs_type, flags, dev_name, data, firstfs_fill_super);
+    ret = mount_nodev(fs_type, flags, data, firstfs_fill_super);
 
     if (unlikely(IS_ERR(ret)))
         printk(KERN_ERR "Error mounting firstfs");
@@ -93,7 +471,7 @@ static struct file_system_type firstfs_type = {
         .name           = "firstfs",
         .mount          = firstfs_mount,
         .kill_sb        = firstfs_kill_superblock,
-        .fs_flags       = FS_USERNS_MOUNT,
+        //no FS_USERNS_MOUNT: our pages are unevictable, like ramfs only the real root can mount us
 };
 
 static int firstfs_init(void)
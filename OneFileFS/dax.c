@@ -0,0 +1,180 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+#include <linux/dax.h>
+#include <linux/iomap.h>
+#include <linux/writeback.h>
+
+#include "onefilefs.h"
+
+//DAX support, used when the filesystem is mounted with -o dax on a pmem device
+//reads, writes and page faults are served directly from the device memory, no page cache and no buffer heads
+//the dax core asks us where a file offset lives on the device through the iomap operations below
+
+#ifdef CONFIG_FS_DAX
+
+//map a range of the file to the device
+//our file is a single data block, so everything inside the block is mapped and everything after it is a hole
+static int onefilefs_iomap_begin(struct inode *inode, loff_t pos, loff_t length, unsigned flags, struct iomap *iomap, struct iomap *srcmap)
+{
+    struct onefilefs_inode *ofs_inode = inode->i_private;
+    struct super_block *sb = inode->i_sb;
+    struct onefilefs_fs_info *fs_info = sb->s_fs_info;
+
+    iomap->bdev = sb->s_bdev;
+    iomap->dax_dev = fs_info->dax_dev;
+    iomap->flags = 0;
+
+    if (pos >= ONEFILEFS_DEFAULT_BLOCK_SIZE) {
+        //we cannot allocate new blocks
+        if (flags & IOMAP_WRITE)
+            return -ENOSPC;
+
+        iomap->type = IOMAP_HOLE;
+        iomap->addr = IOMAP_NULL_ADDR;
+        iomap->offset = round_down(pos, ONEFILEFS_DEFAULT_BLOCK_SIZE);
+        iomap->length = round_up(pos + length, ONEFILEFS_DEFAULT_BLOCK_SIZE) - iomap->offset;
+        return 0;
+    }
+
+    iomap->type = IOMAP_MAPPED;
+    iomap->addr = (u64)ofs_inode->data_block_number << sb->s_blocksize_bits;
+    iomap->offset = 0;
+    iomap->length = ONEFILEFS_DEFAULT_BLOCK_SIZE;
+
+    return 0;
+}
+
+static const struct iomap_ops onefilefs_iomap_ops = {
+    .iomap_begin = onefilefs_iomap_begin,
+};
+
+static ssize_t onefilefs_dax_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct inode *inode = file_inode(iocb->ki_filp);
+    ssize_t ret;
+
+    if (!iov_iter_count(to))
+        return 0;
+
+    //dax_iomap_rw stops at i_size by itself
+    inode_lock_shared(inode);
+    ret = dax_iomap_rw(iocb, to, &onefilefs_iomap_ops);
+    inode_unlock_shared(inode);
+
+    file_accessed(iocb->ki_filp);
+    return ret;
+}
+
+//same rules of onefilefs_write: the file can grow up to one block and we do not allow holes
+//the dax core wants the inode lock held for write on writes (like ext4 and xfs), so dax writes are not
+//concurrent, the range locks are only used by the normal write
+static ssize_t onefilefs_dax_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct inode *inode = file_inode(iocb->ki_filp);
+    ssize_t ret;
+    int err;
+
+    inode_lock(inode);
+
+    ret = generic_write_checks(iocb, from);
+    if (ret <= 0)
+        goto out_unlock;
+
+    if (iocb->ki_pos >= ONEFILEFS_DEFAULT_BLOCK_SIZE || iocb->ki_pos > i_size_read(inode)) {
+        printk(KERN_ERR "Starting offset is outside file boundaries, pos [%lld], file size [%lld]\n", iocb->ki_pos, i_size_read(inode));
+        ret = 0;
+        goto out_unlock;
+    }
+    iov_iter_truncate(from, ONEFILEFS_DEFAULT_BLOCK_SIZE - iocb->ki_pos);
+
+    ret = file_remove_privs(iocb->ki_filp);
+    if (ret)
+        goto out_unlock;
+
+    ret = file_update_time(iocb->ki_filp);
+    if (ret)
+        goto out_unlock;
+
+    ret = dax_iomap_rw(iocb, from, &onefilefs_iomap_ops);
+
+    if (ret > 0 && iocb->ki_pos > i_size_read(inode)) {
+        err = onefilefs_update_file_size(inode, iocb->ki_pos);
+        if (err)
+            ret = err;
+    }
+
+out_unlock:
+    inode_unlock(inode);
+    if (ret > 0)
+        ret = generic_write_sync(iocb, ret);
+    return ret;
+}
+
+//page fault on a dax mapping, the pfn of the device memory is inserted directly in the page table
+//the mapping is never bigger than our single block, so we only handle PTE sized faults
+static vm_fault_t onefilefs_dax_fault(struct vm_fault *vmf)
+{
+    struct inode *inode = file_inode(vmf->vma->vm_file);
+    bool write = (vmf->flags & FAULT_FLAG_WRITE) && (vmf->vma->vm_flags & VM_SHARED);
+    vm_fault_t ret;
+
+    if (write) {
+        sb_start_pagefault(inode->i_sb);
+        file_update_time(vmf->vma->vm_file);
+    }
+
+    ret = dax_iomap_fault(vmf, PE_SIZE_PTE, NULL, NULL, &onefilefs_iomap_ops);
+
+    if (write)
+        sb_end_pagefault(inode->i_sb);
+
+    return ret;
+}
+
+static const struct vm_operations_struct onefilefs_dax_vm_ops = {
+    .fault = onefilefs_dax_fault,
+    .page_mkwrite = onefilefs_dax_fault,
+    .pfn_mkwrite = onefilefs_dax_fault,
+};
+
+static int onefilefs_dax_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    file_accessed(file);
+    vma->vm_ops = &onefilefs_dax_vm_ops;
+    return 0;
+}
+
+const struct file_operations onefilefs_dax_file_operations = {
+    .llseek = generic_file_llseek,
+    .read_iter = onefilefs_dax_read_iter,
+    .write_iter = onefilefs_dax_write_iter,
+    .mmap = onefilefs_dax_mmap,
+    .fsync = generic_file_fsync,
+};
+
+#else
+
+//the kernel has no dax support, the mount option is refused in onefilefs_fill_super, so this is never used
+const struct file_operations onefilefs_dax_file_operations = {};
+
+#endif
+
+//writeback of a dax mapping only has to flush the cpu caches for the dirty ranges
+static int onefilefs_dax_writepages(struct address_space *mapping, struct writeback_control *wbc)
+{
+    struct onefilefs_fs_info *fs_info = mapping->host->i_sb->s_fs_info;
+
+    return dax_writeback_mapping_range(mapping, fs_info->dax_dev, wbc);
+}
+
+//there are no pages in a dax mapping
+const struct address_space_operations onefilefs_dax_aops = {
+    .writepages = onefilefs_dax_writepages,
+    .direct_IO = noop_direct_IO,
+    .set_page_dirty = noop_set_page_dirty,
+    .invalidatepage = noop_invalidatepage,
+};
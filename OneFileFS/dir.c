@@ -32,6 +32,14 @@ static int onefilefs_iterate(struct file *file, struct dir_context* ctx)
         return -ENOTDIR;
     }
 
+    //first call of this readdir, after it the caller usually looks up (stat) every child
+    //so together with the dir block we start reading the inode block too
+    if (ctx->pos == 0) {
+        uint64_t meta_blocks[] = { sfs_inode->data_block_number, ONEFILEFS_INODES_BLOCK_NUMBER };
+
+        onefilefs_readahead_blocks(sb, meta_blocks, ARRAY_SIZE(meta_blocks));
+    }
+
     //read the information from the device
     bh = (struct buffer_head *)sb_bread(sb, sfs_inode->data_block_number);
 
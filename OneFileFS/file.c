@@ -7,19 +7,37 @@
 #include <linux/types.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/writeback.h>
+#include <linux/blkdev.h>
 
 #include "onefilefs.h"
 
-//no concurrent writes for now - only one file and one block anyway
-static DEFINE_MUTEX(onefilefs_write_lock);
+//writes to the file are serialized only when their ranges overlap (see range_lock.c)
+//the inode block is shared by all our inodes so it still has a single lock
 static DEFINE_MUTEX(onefilefs_inodes_lock);
 
+//start reading the metadata blocks we are about to need, without waiting for them
+//under the plug the block layer gets all the requests together and can merge the adjacent ones,
+//so a cold lookup or readdir pays one device round trip instead of one for each block
+//blocks already in the buffer cache are skipped by sb_breadahead
+void onefilefs_readahead_blocks(struct super_block *sb, const uint64_t *blocks, int nr)
+{
+    struct blk_plug plug;
+    int i;
+
+    blk_start_plug(&plug);
+    for (i = 0; i < nr; i++)
+        sb_breadahead(sb, blocks[i]);
+    blk_finish_plug(&plug);
+}
+
 // get an inode from its inode number
 // currently we have only one inode, the root inode, which is in block 1, so we simply return that
 // internal function
 struct onefilefs_inode *onefilefs_get_inode(struct super_block *sb, uint64_t inode_no)
 {
-    struct onefilefs_sb_info *sfs_sb = sb->s_fs_info;
+    struct onefilefs_fs_info *fs_info = sb->s_fs_info;
+    struct onefilefs_sb_info *sfs_sb = fs_info->disk_sb;
     struct onefilefs_inode *ofs_inode = NULL;
     struct onefilefs_inode *to_return = NULL;
 
@@ -70,6 +88,9 @@ ssize_t onefilefs_read(struct file * filp, char __user * buf, size_t len, loff_t
 
     brelse(bh);
 
+    //atime only changes in memory, it reaches the device at writeback (see onefilefs_write_inode)
+    file_accessed(filp);
+
     *off += nbytes;
     return nbytes;
 }
@@ -78,10 +99,11 @@ ssize_t onefilefs_read(struct file * filp, char __user * buf, size_t len, loff_t
 ssize_t onefilefs_write(struct file * filp, const char __user * buf, size_t len, loff_t * off)
 {
     struct onefilefs_inode *ofs_inode = filp->f_inode->i_private;
-    struct onefilefs_inode *device_inode;
+    struct onefilefs_range_lock range;
     struct buffer_head *bh;
     struct super_block* sb = filp->f_inode->i_sb;
     char *buffer;
+    ssize_t ret;
 
     //check that off is whithin boundaries of the block (so offset can go from 0 to BLOCK_SIZE)
     if (*off >= ONEFILEFS_DEFAULT_BLOCK_SIZE)
@@ -97,13 +119,17 @@ ssize_t onefilefs_write(struct file * filp, const char __user * buf, size_t len,
         return 0;
     }
 
-    //get write mutex
-    if (mutex_lock_interruptible(&onefilefs_write_lock)) {
-        printk(KERN_ERR "Failed to acquire mutex lock %s +%d\n", __FILE__, __LINE__);
+    if (!len)
         return 0;
-    }
 
-    printk(KERN_INFO "Starting write. pos[%lld], inode number[%llu], superblock magic [%lu], datablock number [%llu]\n", *off, ofs_inode->inode_no, sb->s_magic,  ofs_inode->data_block_number);
+    //lock only the bytes we write, a write that grows the file locks everything after it so appends are serialized
+    onefilefs_range_lock_init(&range, *off, *off + len > ofs_inode->file_size ? U64_MAX : *off + len - 1);
+    //interrupted by a signal, nothing has been written yet so the write can be restarted
+    if (onefilefs_range_lock(&ONEFILEFS_I(filp->f_inode)->range_locks, &range))
+        return -ERESTARTSYS;
+
+    //printk here would serialize the parallel writers on the console
+    pr_debug("Starting write. pos[%lld], inode number[%llu], superblock magic [%lu], datablock number [%llu]\n", *off, ofs_inode->inode_no, sb->s_magic,  ofs_inode->data_block_number);
 
 
     //read the block, memcpy in change, mark block as dirty
@@ -111,6 +137,7 @@ ssize_t onefilefs_write(struct file * filp, const char __user * buf, size_t len,
     buffer = (char *)bh->b_data;
     if (copy_from_user(buffer + *off, buf, len)) {
         brelse(bh);
+        onefilefs_range_unlock(&ONEFILEFS_I(filp->f_inode)->range_locks, &range);
         printk(KERN_ERR "Error copying file contents from the userspace buffer to the kernel space\n");
         return -EFAULT;
     }
@@ -118,40 +145,129 @@ ssize_t onefilefs_write(struct file * filp, const char __user * buf, size_t len,
     *off += len;
     
     //mark buffer as dirty - system will update it when ready
-    mark_buffer_dirty(bh);
+    //the buffer is linked to the inode so fsync (sync_mapping_buffers) writes it too
+    mark_buffer_dirty_inode(bh, filp->f_inode);
+
+    //same as atime, mtime and ctime are written back with the inode
+    file_update_time(filp);
 
-    //release mutex and memory
-    mutex_unlock(&onefilefs_write_lock);
     brelse(bh);
 
-    //not update inode file size if necessary
+    //not update inode file size if necessary, still under the range lock so appends see the new size
+    ret = len;
     if (*off > ofs_inode->file_size) {
+        ret = onefilefs_update_file_size(filp->f_inode, *off);
+        if (!ret)
+            ret = len;
+    }
 
-        if (mutex_lock_interruptible(&onefilefs_inodes_lock)) {
-            printk(KERN_ERR "Failed to acquire mutex lock %s +%d\n", __FILE__, __LINE__);
-            return 0;
-        }
-
-        //load the block and save the new inode
-        bh = (struct buffer_head *)sb_bread(sb, ONEFILEFS_INODES_BLOCK_NUMBER);
+    //release range lock
+    onefilefs_range_unlock(&ONEFILEFS_I(filp->f_inode)->range_locks, &range);
     
-        device_inode = (struct onefilefs_inode*) bh->b_data;
+    return ret;
+}
 
-        //we only have one file inode and its always in the same place so we don't need to iterate
-        device_inode++;
+//copy the timestamps stored on the device in the vfs inode
+void onefilefs_fill_inode_times(struct inode *inode, struct onefilefs_inode *ofs_inode)
+{
+    inode->i_atime.tv_sec = ofs_inode->atime_sec;
+    inode->i_atime.tv_nsec = ofs_inode->atime_nsec;
+    inode->i_mtime.tv_sec = ofs_inode->mtime_sec;
+    inode->i_mtime.tv_nsec = ofs_inode->mtime_nsec;
+    inode->i_ctime.tv_sec = ofs_inode->ctime_sec;
+    inode->i_ctime.tv_nsec = ofs_inode->ctime_nsec;
+}
 
-        //size update here
-        device_inode->file_size = *off;
+//called by the VFS to write a dirty inode back to the device
+//timestamp changes only mark the inode dirty (only I_DIRTY_TIME with lazytime), so this is the only place where we write them,
+//it happens at writeback, fsync, sync or when the inode is evicted and not on every read or write
+int onefilefs_write_inode(struct inode *inode, struct writeback_control *wbc)
+{
+    struct onefilefs_fs_info *fs_info = inode->i_sb->s_fs_info;
+    struct onefilefs_inode *device_inode;
+    struct buffer_head *bh;
+    int i, ret = 0;
 
-        mark_buffer_dirty(bh);
-        brelse(bh);
+    mutex_lock(&onefilefs_inodes_lock);
+
+    bh = (struct buffer_head *)sb_bread(inode->i_sb, ONEFILEFS_INODES_BLOCK_NUMBER);
+    if (!bh) {
         mutex_unlock(&onefilefs_inodes_lock);
+        return -EIO;
+    }
 
-        printk(KERN_INFO "File inode size correctly updated\n");
+    device_inode = (struct onefilefs_inode *) bh->b_data;
+    for (i = 0; i < fs_info->disk_sb->inodes_count; i++) {
+        if (device_inode->inode_no == inode->i_ino)
+            break;
+        device_inode++;
+    }
 
+    if (i == fs_info->disk_sb->inodes_count) {
+        printk(KERN_ERR "inode %lu not found in the inode block\n", inode->i_ino);
+        ret = -EIO;
+        goto out;
     }
-    
-    return len;
+
+    device_inode->atime_sec = inode->i_atime.tv_sec;
+    device_inode->atime_nsec = inode->i_atime.tv_nsec;
+    device_inode->mtime_sec = inode->i_mtime.tv_sec;
+    device_inode->mtime_nsec = inode->i_mtime.tv_nsec;
+    device_inode->ctime_sec = inode->i_ctime.tv_sec;
+    device_inode->ctime_nsec = inode->i_ctime.tv_nsec;
+
+    mark_buffer_dirty(bh);
+    if (wbc->sync_mode == WB_SYNC_ALL) {
+        sync_dirty_buffer(bh);
+        if (buffer_req(bh) && !buffer_uptodate(bh))
+            ret = -EIO;
+    }
+
+out:
+    brelse(bh);
+    mutex_unlock(&onefilefs_inodes_lock);
+    return ret;
+}
+
+//update the size of our file, both in memory and in the inode block on the device
+//used by both the normal and the dax write
+int onefilefs_update_file_size(struct inode *inode, loff_t size)
+{
+    struct onefilefs_inode *ofs_inode = inode->i_private;
+    struct onefilefs_inode *device_inode;
+    struct buffer_head *bh;
+
+    //the data is already in the block, we cannot give up on the size because of a signal
+    mutex_lock(&onefilefs_inodes_lock);
+
+    //load the block and save the new inode
+    bh = (struct buffer_head *)sb_bread(inode->i_sb, ONEFILEFS_INODES_BLOCK_NUMBER);
+    if (!bh) {
+        mutex_unlock(&onefilefs_inodes_lock);
+        return -EIO;
+    }
+
+    device_inode = (struct onefilefs_inode*) bh->b_data;
+
+    //we only have one file inode and its always in the same place so we don't need to iterate
+    device_inode++;
+
+    //size update here
+    device_inode->file_size = size;
+    ofs_inode->file_size = size;
+    i_size_write(inode, size);
+
+    //the inode block is linked to the inode, so fsync/fdatasync (sync_mapping_buffers) write it
+    mark_buffer_dirty_inode(bh, inode);
+    brelse(bh);
+    mutex_unlock(&onefilefs_inodes_lock);
+
+    //a size change is I_DIRTY_DATASYNC, fdatasync must not skip it
+    mark_inode_dirty(inode);
+
+    printk(KERN_INFO "File inode size correctly updated\n");
+
+    return 0;
 }
 
 
@@ -162,11 +278,15 @@ struct dentry *onefilefs_lookup(struct inode *parent_inode, struct dentry *child
 {
     struct onefilefs_inode *parent = parent_inode->i_private;
     struct super_block *sb = parent_inode->i_sb;
+    struct onefilefs_fs_info *fs_info = sb->s_fs_info;
     struct buffer_head *bh;
     struct onefilefs_dir_record *record;
-    struct timespec64 curr_time;
+    uint64_t meta_blocks[] = { parent->data_block_number, ONEFILEFS_INODES_BLOCK_NUMBER };
     int i;
 
+    //if we find the child we will need its inode right after the dir block, read both at once
+    onefilefs_readahead_blocks(sb, meta_blocks, ARRAY_SIZE(meta_blocks));
+
     //we never return a dentry currently, we should check if the dentry is already connected, if it is, we return it
     bh = (struct buffer_head *)sb_bread(sb, parent->data_block_number);
     record = (struct onefilefs_dir_record *) bh->b_data;
@@ -177,31 +297,57 @@ struct dentry *onefilefs_lookup(struct inode *parent_inode, struct dentry *child
             struct inode *inode;
             struct onefilefs_inode *ofs_inode;
 
+            //the inode is hashed so the VFS can find it again and write it back when it gets dirty
+            inode = iget_locked(sb, record->inode_no);
+            if (!inode) {
+                brelse(bh);
+                return ERR_PTR(-ENOMEM);
+            }
+
+            //already in memory, nothing to read from the device
+            if (!(inode->i_state & I_NEW)) {
+                brelse(bh);
+                d_add(child_dentry, inode);
+                return NULL;
+            }
+
             ofs_inode = onefilefs_get_inode(sb, record->inode_no);
+            brelse(bh);
+            if (!ofs_inode) {
+                printk(KERN_ERR "inode %lu not found in the inode block\n", inode->i_ino);
+                //drops the I_NEW inode, or the next lookup of this ino would wait for it forever
+                iget_failed(inode);
+                return ERR_PTR(-EIO);
+            }
 
-            inode = new_inode(sb);
-            inode->i_ino = record->inode_no;
             //inode_init_owner(inode, parent_inode, ofs_inode->mode);
             inode->i_mode = ofs_inode->mode;
             inode->i_sb = sb;
             inode->i_op = &onefilefs_inode_ops;
             
             //check inode type (we now have two, a file and a dir, very fancy)    
-            if (S_ISDIR(inode->i_mode))
+            if (S_ISDIR(inode->i_mode)) {
                 inode->i_fop = &onefilefs_dir_operations;
-            else if (S_ISREG(inode->i_mode))
-                inode->i_fop = &onefilefs_file_operations;
-            else
+            } else if (S_ISREG(inode->i_mode)) {
+                inode->i_size = ofs_inode->file_size;
+                //with -o dax reads, writes and faults go straight to the device memory
+                if (fs_info->mount_opt & ONEFILEFS_MOUNT_DAX) {
+                    inode->i_flags |= S_DAX;
+                    inode->i_fop = &onefilefs_dax_file_operations;
+                    inode->i_mapping->a_ops = &onefilefs_dax_aops;
+                } else {
+                    inode->i_fop = &onefilefs_file_operations;
+                }
+            } else
                 printk(KERN_ERR "Unknown inode type. Neither a directory nor a file");
 
-            /* FIXME: We should store these times to disk and retrieve them */
-            ktime_get_real_ts64(&curr_time);
-            inode->i_atime = inode->i_mtime = inode->i_ctime = curr_time;
+            onefilefs_fill_inode_times(inode, ofs_inode);
 
             inode->i_private = ofs_inode;
+            unlock_new_inode(inode);
 
+            //ofs_inode now belongs to the inode, it is freed in onefilefs_evict_inode
             d_add(child_dentry, inode);
-            kfree(ofs_inode);
             return NULL;
         }
     }
@@ -217,5 +363,6 @@ const struct inode_operations onefilefs_inode_ops = {
 
 const struct file_operations onefilefs_file_operations = {
     .read = onefilefs_read,
-    .write = onefilefs_write
+    .write = onefilefs_write,
+    .fsync = generic_file_fsync,
 };
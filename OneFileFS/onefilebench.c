@@ -0,0 +1,125 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "onefilefs.h"
+
+/*
+	Parallel write benchmark for the range locks.
+	The file is first filled up to one block, then N threads write
+	each its own stripe of the block over and over, no write grows the
+	file so they should never wait for each other.
+*/
+
+struct stripe {
+	pthread_t thread;
+	int fd;
+	off_t offset;
+	size_t size;
+	long iterations;
+	int failed;
+};
+
+static void *write_stripe(void *arg)
+{
+	struct stripe *stripe = arg;
+	char *buffer;
+	ssize_t ret;
+	long i;
+
+	buffer = malloc(stripe->size);
+	memset(buffer, 'a' + (stripe->offset / stripe->size) % 26, stripe->size);
+
+	for (i = 0; i < stripe->iterations; i++) {
+		ret = pwrite(stripe->fd, buffer, stripe->size, stripe->offset);
+		if (ret != stripe->size) {
+			stripe->failed = 1;
+			break;
+		}
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, nthreads, i, failed = 0;
+	long iterations;
+	size_t stripe_size;
+	struct stripe *stripes;
+	struct timespec start, end;
+	double elapsed, total_bytes;
+	char block[ONEFILEFS_DEFAULT_BLOCK_SIZE];
+
+	if (argc != 4) {
+		printf("Usage: onefilebench <file> <threads> <iterations per thread>\n");
+		return -1;
+	}
+
+	nthreads = atoi(argv[2]);
+	iterations = atol(argv[3]);
+	if (nthreads <= 0 || nthreads > ONEFILEFS_DEFAULT_BLOCK_SIZE || iterations <= 0) {
+		printf("threads must be between 1 and %d, iterations more than 0\n", ONEFILEFS_DEFAULT_BLOCK_SIZE);
+		return -1;
+	}
+
+	fd = open(argv[1], O_RDWR);
+	if (fd == -1) {
+		perror("Error opening the file");
+		return -1;
+	}
+
+	//grow the file to the whole block, so the threads only overwrite
+	memset(block, ' ', sizeof(block));
+	if (pwrite(fd, block, sizeof(block), 0) != sizeof(block)) {
+		printf("Could not fill the file up to one block\n");
+		close(fd);
+		return -1;
+	}
+
+	stripe_size = ONEFILEFS_DEFAULT_BLOCK_SIZE / nthreads;
+	stripes = calloc(nthreads, sizeof(struct stripe));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nthreads; i++) {
+		stripes[i].fd = fd;
+		stripes[i].offset = i * stripe_size;
+		stripes[i].size = stripe_size;
+		stripes[i].iterations = iterations;
+		if (pthread_create(&stripes[i].thread, NULL, write_stripe, &stripes[i])) {
+			perror("Error creating the thread");
+			close(fd);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(stripes[i].thread, NULL);
+		failed |= stripes[i].failed;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (failed)
+		printf("Some writes failed or were short\n");
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	total_bytes = (double)nthreads * iterations * stripe_size;
+
+	printf("%d threads, stripe of %zu bytes, %ld writes each\n", nthreads, stripe_size, iterations);
+	printf("%.3f s, %.0f writes/s, %.2f MB/s\n", elapsed, nthreads * iterations / elapsed, total_bytes / elapsed / (1024 * 1024));
+
+	free(stripes);
+	close(fd);
+
+	return failed;
+}
@@ -4,6 +4,8 @@
 #include <linux/types.h>
 
 #define ONEFILEFS_MAGIC 0x42424242
+//version 2 added the timestamps to the inode, version 1 images have a different inode layout
+#define ONEFILEFS_VERSION 2
 #define ONEFILEFS_DEFAULT_BLOCK_SIZE 4096
 #define ONEFILEFS_FILENAME_MAXLEN 255
 
@@ -27,6 +29,14 @@ struct onefilefs_inode {
 		uint64_t file_size;
 		uint64_t dir_children_count;
 	};
+
+	//timestamps, updated lazily (see onefilefs_write_inode)
+	uint64_t atime_sec;
+	uint64_t mtime_sec;
+	uint64_t ctime_sec;
+	uint32_t atime_nsec;
+	uint32_t mtime_nsec;
+	uint32_t ctime_nsec;
 };
 
 //dir definition (how the dir datablock is organized)
@@ -49,12 +59,75 @@ struct onefilefs_sb_info {
 	char padding[ (4 * 1024) - (5 * sizeof(uint64_t))];
 };
 
+//mount options
+#define ONEFILEFS_MOUNT_DAX 0x0001
+
+//in-memory superblock information (what we keep in sb->s_fs_info)
+struct onefilefs_fs_info {
+	struct onefilefs_sb_info *disk_sb; //points inside sb_bh, which we keep until umount
+	struct buffer_head *sb_bh;
+	unsigned long mount_opt;
+	struct dax_device *dax_dev;
+};
+
+#ifdef __KERNEL__
+#include <linux/fs.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+//byte range lock, one tree for each inode (see range_lock.c)
+struct onefilefs_range_lock_tree {
+	struct rb_root_cached root;
+	spinlock_t lock;
+	u64 seqnum;
+};
+
+struct onefilefs_range_lock {
+	struct rb_node rb;
+	u64 start;
+	u64 last;
+	u64 subtree_last;
+	struct task_struct *task;
+	unsigned int blocking_ranges; //overlapping ranges locked before us
+	u64 seqnum;
+};
+
+//in-memory inode, the vfs inode plus what we need for each file
+struct onefilefs_inode_info {
+	struct onefilefs_range_lock_tree range_locks;
+	struct inode vfs_inode;
+};
+
+static inline struct onefilefs_inode_info *ONEFILEFS_I(struct inode *inode)
+{
+	return container_of(inode, struct onefilefs_inode_info, vfs_inode);
+}
+#endif
+
 // file.c
 extern const struct inode_operations onefilefs_inode_ops;
 extern const struct file_operations onefilefs_file_operations; 
 extern struct onefilefs_inode *onefilefs_get_inode(struct super_block *sb, uint64_t inode_no);
+#ifdef __KERNEL__
+extern void onefilefs_readahead_blocks(struct super_block *sb, const uint64_t *blocks, int nr);
+extern int onefilefs_update_file_size(struct inode *inode, loff_t size);
+extern void onefilefs_fill_inode_times(struct inode *inode, struct onefilefs_inode *ofs_inode);
+extern int onefilefs_write_inode(struct inode *inode, struct writeback_control *wbc);
+#endif
 
 // dir.c
 extern const struct file_operations onefilefs_dir_operations;
 
+// dax.c
+extern const struct file_operations onefilefs_dax_file_operations;
+extern const struct address_space_operations onefilefs_dax_aops;
+
+// range_lock.c
+#ifdef __KERNEL__
+extern void onefilefs_range_lock_tree_init(struct onefilefs_range_lock_tree *tree);
+extern void onefilefs_range_lock_init(struct onefilefs_range_lock *lock, uint64_t start, uint64_t last);
+extern int onefilefs_range_lock(struct onefilefs_range_lock_tree *tree, struct onefilefs_range_lock *lock);
+extern void onefilefs_range_unlock(struct onefilefs_range_lock_tree *tree, struct onefilefs_range_lock *lock);
+#endif
+
 #endif
\ No newline at end of file
@@ -7,9 +7,118 @@
 #include <linux/types.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
+#include <linux/dax.h>
 
 #include "onefilefs.h"
 
+enum {
+    Opt_dax, Opt_err
+};
+
+static const match_table_t tokens = {
+    {Opt_dax, "dax"},
+    {Opt_err, NULL}
+};
+
+//parse the options passed with -o when mounting, the string is like "opt1,opt2"
+static int onefilefs_parse_options(char *options, struct onefilefs_fs_info *fs_info)
+{
+    substring_t args[MAX_OPT_ARGS];
+    char *p;
+    int token;
+
+    if (!options)
+        return 0;
+
+    while ((p = strsep(&options, ",")) != NULL) {
+        if (!*p)
+            continue;
+
+        token = match_token(p, tokens, args);
+        switch (token) {
+        case Opt_dax:
+            fs_info->mount_opt |= ONEFILEFS_MOUNT_DAX;
+            break;
+        default:
+            printk(KERN_ERR "onefilefs: unrecognized mount option \"%s\"\n", p);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+//called when an inode is not used anymore, we free the copy of the device inode we keep in i_private
+static void onefilefs_evict_inode(struct inode *inode)
+{
+    truncate_inode_pages_final(&inode->i_data);
+    clear_inode(inode);
+    kfree(inode->i_private);
+    inode->i_private = NULL;
+}
+
+//called on umount, release what we got in onefilefs_fill_super
+static void onefilefs_put_super(struct super_block *sb)
+{
+    struct onefilefs_fs_info *fs_info = sb->s_fs_info;
+
+    fs_put_dax(fs_info->dax_dev);
+    brelse(fs_info->sb_bh);
+    kfree(fs_info);
+    sb->s_fs_info = NULL;
+}
+
+//what we show in /proc/mounts
+static int onefilefs_show_options(struct seq_file *seq, struct dentry *root)
+{
+    struct onefilefs_fs_info *fs_info = root->d_sb->s_fs_info;
+
+    if (fs_info->mount_opt & ONEFILEFS_MOUNT_DAX)
+        seq_puts(seq, ",dax");
+
+    return 0;
+}
+
+//our inodes have the range lock tree next to them, they come from their own slab cache
+static struct kmem_cache *onefilefs_inode_cachep;
+
+//slab constructor, called only when the object is created, not on every allocation
+//the range lock tree is always empty when an inode is freed so it can be initialized here too
+static void onefilefs_inode_init_once(void *foo)
+{
+    struct onefilefs_inode_info *info = foo;
+
+    inode_init_once(&info->vfs_inode);
+    onefilefs_range_lock_tree_init(&info->range_locks);
+}
+
+static struct inode *onefilefs_alloc_inode(struct super_block *sb)
+{
+    struct onefilefs_inode_info *info;
+
+    info = kmem_cache_alloc(onefilefs_inode_cachep, GFP_KERNEL);
+    if (!info)
+        return NULL;
+
+    return &info->vfs_inode;
+}
+
+static void onefilefs_free_inode(struct inode *inode)
+{
+    kmem_cache_free(onefilefs_inode_cachep, ONEFILEFS_I(inode));
+}
+
+static const struct super_operations onefilefs_super_ops = {
+    .alloc_inode = onefilefs_alloc_inode,
+    .free_inode = onefilefs_free_inode,
+    .write_inode = onefilefs_write_inode,
+    .evict_inode = onefilefs_evict_inode,
+    .put_super = onefilefs_put_super,
+    .show_options = onefilefs_show_options,
+};
+
 //function that fill the super block with information
 //not much inside for now
 int onefilefs_fill_super(struct super_block *sb, void *data, int silent)
@@ -17,10 +126,22 @@ int onefilefs_fill_super(struct super_block *sb, void *data, int silent)
     struct inode *root_inode;
     struct buffer_head *bh;
     struct onefilefs_sb_info *sb_disk;
-    struct timespec64 curr_time;
+    struct onefilefs_fs_info *fs_info;
+    uint64_t mount_blocks[] = { ONEFILEFS_INODES_BLOCK_NUMBER, ONEFILEFS_ROOT_DATA_BLOCK_NUMBER };
+    int ret;
+
+    //our blocks are always 4K, no matter what the device uses
+    if (!sb_set_blocksize(sb, ONEFILEFS_DEFAULT_BLOCK_SIZE)) {
+        printk(KERN_ERR "onefilefs could not set the block size of the device to [%d]", ONEFILEFS_DEFAULT_BLOCK_SIZE);
+        return -EINVAL;
+    }
 
     //we now look if the block device has a superblock with the correct information
     bh = (struct buffer_head *)sb_bread(sb, ONEFILEFS_SB_BLOCK_NUMBER);
+    if (!bh) {
+        printk(KERN_ERR "onefilefs could not read the superblock from the device\n");
+        return -EIO;
+    }
 
     sb_disk = (struct onefilefs_sb_info *)bh->b_data;
 
@@ -28,20 +149,53 @@ int onefilefs_fill_super(struct super_block *sb, void *data, int silent)
 
     if (unlikely(sb_disk->magic != ONEFILEFS_MAGIC)) {
         printk(KERN_ERR "The filesystem that you try to mount is not of type onefilefs. Magicnumber mismatch.");
+        brelse(bh);
         return -EPERM;
     }
 
     if (unlikely(sb_disk->block_size != ONEFILEFS_DEFAULT_BLOCK_SIZE)) {
         printk(KERN_ERR "onefilefs seem to be formatted using a non-standard block size.");
+        brelse(bh);
         return -EPERM;
     }
 
+    if (unlikely(sb_disk->version != ONEFILEFS_VERSION)) {
+        printk(KERN_ERR "onefilefs version [%lld] is not supported (expected [%d]), format the device again with onefilemakefs\n", sb_disk->version, ONEFILEFS_VERSION);
+        brelse(bh);
+        return -EINVAL;
+    }
+
     printk(KERN_INFO "onefilefs filesystem of version [%lld] formatted with a block size of [%lld] detected in the device.\n", sb_disk->version, sb_disk->block_size);
 
     //Unique identifier of the filesystem
     sb->s_magic = ONEFILEFS_MAGIC;
 
-    sb->s_fs_info = sb_disk; // <--- ??
+    //keep the superblock buffer around, s_fs_info points into it
+    fs_info = kzalloc(sizeof(struct onefilefs_fs_info), GFP_KERNEL);
+    if (!fs_info) {
+        brelse(bh);
+        return -ENOMEM;
+    }
+    fs_info->sb_bh = bh;
+    fs_info->disk_sb = sb_disk;
+
+    ret = onefilefs_parse_options(data, fs_info);
+    if (ret)
+        goto out_free_info;
+
+    //dax needs a device that can be accessed directly as memory (pmem)
+    if (fs_info->mount_opt & ONEFILEFS_MOUNT_DAX) {
+        if (!IS_ENABLED(CONFIG_FS_DAX) || !bdev_dax_supported(sb->s_bdev, ONEFILEFS_DEFAULT_BLOCK_SIZE)) {
+            printk(KERN_ERR "onefilefs: DAX unsupported by the block device\n");
+            ret = -EINVAL;
+            goto out_free_info;
+        }
+        fs_info->dax_dev = fs_dax_get_by_bdev(sb->s_bdev);
+        printk(KERN_INFO "onefilefs: DAX enabled\n");
+    }
+
+    sb->s_fs_info = fs_info;
+    sb->s_op = &onefilefs_super_ops;
 
     //set up our root inode
     root_inode = new_inode(sb);
@@ -51,23 +205,44 @@ int onefilefs_fill_super(struct super_block *sb, void *data, int silent)
     root_inode->i_op = &onefilefs_inode_ops;
     root_inode->i_fop = &onefilefs_dir_operations;
 
-    ktime_get_real_ts64(&curr_time);
-    root_inode->i_atime = root_inode->i_mtime = root_inode->i_ctime = curr_time;
+    //the first thing after the mount is usually a readdir of the root, read its block together with the inodes
+    onefilefs_readahead_blocks(sb, mount_blocks, ARRAY_SIZE(mount_blocks));
 
     //get our root inode from the disk insted of the superblock
     root_inode->i_private = onefilefs_get_inode(sb, ONEFILEFS_ROOT_INODE_NUMBER);
+    if (!root_inode->i_private) {
+        printk(KERN_ERR "onefilefs could not read the root inode\n");
+        iput(root_inode);
+        ret = -EIO;
+        goto out_free_info;
+    }
+    onefilefs_fill_inode_times(root_inode, root_inode->i_private);
+
+    //hashed inodes get written back when dirty (e.g. atime changed by ls)
+    insert_inode_hash(root_inode);
 
     sb->s_root = d_make_root(root_inode);
-    if (!sb->s_root)
-        return -ENOMEM;
+    if (!sb->s_root) {
+        ret = -ENOMEM;
+        goto out_free_info;
+    }
 
     return 0;
+
+out_free_info:
+    //onefilefs_put_super only runs once we have a root, before that we clean up here
+    fs_put_dax(fs_info->dax_dev);
+    brelse(bh);
+    kfree(fs_info);
+    sb->s_fs_info = NULL;
+    return ret;
 }
 
 static void onefilefs_kill_superblock(struct super_block *s)
 {
+    //this evicts all the inodes and calls onefilefs_put_super
+    kill_block_super(s);
     printk(KERN_INFO "onefilefs superblock is destroyed. Unmount succesful.\n");
-    //we have no information in our superblock currently
     return;
 }
 
@@ -102,12 +277,21 @@ static int onefilefs_init(void)
 {
     int ret;
 
+    onefilefs_inode_cachep = kmem_cache_create("onefilefs_inode_cache", sizeof(struct onefilefs_inode_info), 0,
+                                               SLAB_RECLAIM_ACCOUNT | SLAB_ACCOUNT, onefilefs_inode_init_once);
+    if (!onefilefs_inode_cachep) {
+        printk(KERN_ERR "Failed to create the onefilefs inode cache\n");
+        return -ENOMEM;
+    }
+
     //register filesystem
     ret = register_filesystem(&onefilefs_type);
-    if (likely(ret == 0))
+    if (likely(ret == 0)) {
         printk(KERN_INFO "Sucessfully registered onefilefs\n");
-    else
+    } else {
         printk(KERN_ERR "Failed to register onefilefs. Error:[%d]", ret);
+        kmem_cache_destroy(onefilefs_inode_cachep);
+    }
 
     return ret;
 }
@@ -123,6 +307,10 @@ static void onefilefs_exit(void)
         printk(KERN_INFO "Sucessfully unregistered onefilefs\n");
     else
         printk(KERN_ERR "Failed to unregister onefilefs. Error:[%d]", ret);
+
+    //inodes are freed after an RCU grace period, wait for them before destroying the cache
+    rcu_barrier();
+    kmem_cache_destroy(onefilefs_inode_cachep);
 }
 
 module_init(onefilefs_init);
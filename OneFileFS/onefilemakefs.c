@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "onefilefs.h"
 
@@ -25,6 +26,7 @@ int main(int argc, char *argv[])
 	struct onefilefs_inode file_inode;
 	struct onefilefs_dir_record record;
 	char *block_padding;
+	struct timespec now;
 	char file_name[] = "Hitchhikers guide to the galaxy";
 	char file_body[] = "In the beginning the Universe was created. This has made a lot of people very angry and been widely regarded as a bad move.\n";
 
@@ -40,7 +42,7 @@ int main(int argc, char *argv[])
 	}
 
 	//write superblock
-	sb.version = 1;
+	sb.version = ONEFILEFS_VERSION;
 	sb.magic = ONEFILEFS_MAGIC;
 	sb.block_size = ONEFILEFS_DEFAULT_BLOCK_SIZE;
 	sb.inodes_count = 2; //the root and the file
@@ -57,12 +59,17 @@ int main(int argc, char *argv[])
 
 	printf("Super block written succesfully\n");
 
+	//both inodes are created now
+	clock_gettime(CLOCK_REALTIME, &now);
+
 	//Write root inode
-	root_inode.mode = S_IFDIR;
+	memset(&root_inode, 0, sizeof(root_inode));
 	root_inode.inode_no = ONEFILEFS_ROOT_INODE_NUMBER;
 	root_inode.data_block_number = ONEFILEFS_ROOT_DATA_BLOCK_NUMBER;
 	root_inode.dir_children_count = 1; //our only file
-	root_inode.mode = 0777;
+	root_inode.mode = S_IFDIR | 0777;
+	root_inode.atime_sec = root_inode.mtime_sec = root_inode.ctime_sec = now.tv_sec;
+	root_inode.atime_nsec = root_inode.mtime_nsec = root_inode.ctime_nsec = now.tv_nsec;
 	
 	ret = write(fd, (char *)&root_inode, sizeof(root_inode));
 
@@ -74,11 +81,13 @@ int main(int argc, char *argv[])
 	printf("root inode written succesfully\n");
 
 	// write file inode
-	file_inode.mode = S_IFREG;
+	memset(&file_inode, 0, sizeof(file_inode));
 	file_inode.inode_no = ONEFILEFS_FILE_INODE_NUMBER;
 	file_inode.data_block_number = ONEFILEFS_FILE_DATA_BLOCK_NUMBER;
 	file_inode.file_size = sizeof(file_body);
-	file_inode.mode = 0777;
+	file_inode.mode = S_IFREG | 0777;
+	file_inode.atime_sec = file_inode.mtime_sec = file_inode.ctime_sec = now.tv_sec;
+	file_inode.atime_nsec = file_inode.mtime_nsec = file_inode.ctime_nsec = now.tv_nsec;
 	ret = write(fd, (char *)&file_inode, sizeof(file_inode));
 
 	if (ret != sizeof(root_inode)) {
@@ -0,0 +1,98 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/spinlock.h>
+#include <linux/interval_tree_generic.h>
+
+#include "onefilefs.h"
+
+//byte range locks, so writers of different parts of the same file do not wait for each other
+//every lock is a [start, last] interval in an interval tree of the inode, when we lock we count how many
+//ranges already in the tree overlap ours and we sleep until all of them are unlocked
+//the seqnum tells who came first, an unlock only wakes up the ranges that were inserted after it
+//(the ones before did not count it)
+
+#define RANGE_START(lock) ((lock)->start)
+#define RANGE_LAST(lock) ((lock)->last)
+
+INTERVAL_TREE_DEFINE(struct onefilefs_range_lock, rb, u64, subtree_last, RANGE_START, RANGE_LAST, static, onefilefs_range_it)
+
+void onefilefs_range_lock_tree_init(struct onefilefs_range_lock_tree *tree)
+{
+    tree->root = RB_ROOT_CACHED;
+    spin_lock_init(&tree->lock);
+    tree->seqnum = 0;
+}
+
+// @start, @last: first and last byte of the range (included)
+void onefilefs_range_lock_init(struct onefilefs_range_lock *lock, u64 start, u64 last)
+{
+    RB_CLEAR_NODE(&lock->rb);
+    lock->start = start;
+    lock->last = last;
+    lock->task = NULL;
+    lock->blocking_ranges = 0;
+    lock->seqnum = 0;
+}
+
+// returns -EINTR if we got a signal while waiting, the range is not locked in that case
+int onefilefs_range_lock(struct onefilefs_range_lock_tree *tree, struct onefilefs_range_lock *lock)
+{
+    struct onefilefs_range_lock *node;
+
+    spin_lock(&tree->lock);
+
+    lock->task = current;
+    lock->seqnum = tree->seqnum++;
+    lock->blocking_ranges = 0;
+
+    node = onefilefs_range_it_iter_first(&tree->root, lock->start, lock->last);
+    while (node) {
+        lock->blocking_ranges++;
+        node = onefilefs_range_it_iter_next(node, lock->start, lock->last);
+    }
+    onefilefs_range_it_insert(lock, &tree->root);
+
+    spin_unlock(&tree->lock);
+
+    //blocking_ranges goes down in onefilefs_range_unlock, the last one wakes us up
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!READ_ONCE(lock->blocking_ranges))
+            break;
+
+        //leaving the tree is the same as an unlock for who is waiting on us
+        if (signal_pending(current)) {
+            __set_current_state(TASK_RUNNING);
+            onefilefs_range_unlock(tree, lock);
+            return -EINTR;
+        }
+        schedule();
+    }
+    __set_current_state(TASK_RUNNING);
+
+    return 0;
+}
+
+void onefilefs_range_unlock(struct onefilefs_range_lock_tree *tree, struct onefilefs_range_lock *lock)
+{
+    struct onefilefs_range_lock *node;
+
+    spin_lock(&tree->lock);
+
+    onefilefs_range_it_remove(lock, &tree->root);
+
+    node = onefilefs_range_it_iter_first(&tree->root, lock->start, lock->last);
+    while (node) {
+        if (node->seqnum > lock->seqnum) {
+            node->blocking_ranges--;
+            if (!node->blocking_ranges)
+                wake_up_process(node->task);
+        }
+        node = onefilefs_range_it_iter_next(node, lock->start, lock->last);
+    }
+
+    spin_unlock(&tree->lock);
+}